@@ -0,0 +1,35 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "my_secmalloc.h"
+
+#ifndef PRESET_NAME
+#define PRESET_NAME "default"
+#endif
+
+#define ITERATIONS 100000
+#define SLOTS 8
+
+/*
+ * Malloc/free churn over a small ring of live blocks, reports the mean cost of one operation
+ * An optional argument labels the run, e.g. the log options it was started with
+ */
+int main(int argc, char** argv) {
+    void* slots[SLOTS] = { NULL };
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < ITERATIONS; ++i) {
+        size_t slot = i % SLOTS;
+        my_free(slots[slot]);
+        slots[slot] = my_malloc(16 + (i * 40) % 240);
+    }
+    for (size_t slot = 0; slot < SLOTS; ++slot) {
+        my_free(slots[slot]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double elapsed = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    printf("%-10s %-8s %8.1f ns/op\n", PRESET_NAME, argc > 1 ? argv[1] : "", elapsed / (2.0 * ITERATIONS));
+    return 0;
+}
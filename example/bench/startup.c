@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "my_secmalloc.h"
+
+#ifndef VARIANT_NAME
+#define VARIANT_NAME "lazy"
+#endif
+
+static struct timespec start;
+static long start_faults;
+
+static long minor_faults(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt;
+}
+
+// Runs before the allocator constructor (priority 102), so eager mapping is part of the measure
+__attribute__((constructor(101))) static void start_clock(void) {
+    start_faults = minor_faults();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+}
+
+/*
+ * Time and page faults from process start to a first allocation spanning the whole heap, touched as a first request would
+ * Run it with a deploy sized heap, e.g. SECMALLOC_OPTIONS=size=64m
+ */
+int main(void) {
+    size_t size = my_heap_size() - sizeof(block_t) - 2 * sizeof(size_t);
+    struct timespec ready, end;
+    clock_gettime(CLOCK_MONOTONIC, &ready);
+    long ready_faults = minor_faults();
+
+    char* ptr = my_malloc(size);
+    if (ptr == NULL) {
+        fprintf(stderr, "%s: first allocation failed\n", VARIANT_NAME);
+        return 1;
+    }
+    memset(ptr, 'A', size);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long faults = minor_faults();
+
+    // Startup is paid before main, the first request after it
+    double startup = (ready.tv_sec - start.tv_sec) * 1e6 + (ready.tv_nsec - start.tv_nsec) / 1e3;
+    double request = (end.tv_sec - ready.tv_sec) * 1e6 + (end.tv_nsec - ready.tv_nsec) / 1e3;
+    printf("%-10s heap %zu KiB, startup %8.0f us / %6ld faults, first request %8.0f us / %6ld faults\n",
+           VARIANT_NAME, my_heap_size() / 1024, startup, ready_faults - start_faults, request, faults - ready_faults);
+    my_free(ptr);
+    return 0;
+}
@@ -0,0 +1,148 @@
+#ifndef MY_SECMALLOC_HPP
+#define MY_SECMALLOC_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory_resource>
+#include <new>
+
+#include "my_secmalloc.h"
+
+namespace secmalloc {
+
+// my_malloc keeps every block SECMALLOC_ALIGNMENT aligned, so this much alignment is free
+constexpr std::size_t natural_alignment = SECMALLOC_ALIGNMENT;
+
+static_assert(natural_alignment >= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "plain new must not take the over-aligned path");
+
+namespace detail {
+
+// Over-aligned requests get alignment extra bytes; the raw block pointer is stored just before the user pointer
+inline void* allocate(std::size_t bytes, std::size_t alignment) noexcept {
+    if (bytes == 0) {
+        bytes = 1;
+    }
+    if (alignment <= natural_alignment) {
+        return my_malloc(bytes);
+    }
+    if (bytes > std::numeric_limits<std::size_t>::max() - alignment) {
+        return nullptr;
+    }
+    void* raw = my_malloc(bytes + alignment);
+    if (raw == nullptr) {
+        return nullptr;
+    }
+    std::uintptr_t aligned = (reinterpret_cast<std::uintptr_t>(raw) + alignment) & ~(alignment - 1);
+    reinterpret_cast<void**>(aligned)[-1] = raw;
+    return reinterpret_cast<void*>(aligned);
+}
+
+inline void deallocate(void* ptr, std::size_t bytes, std::size_t alignment) noexcept {
+    if (ptr == nullptr) {
+        return;
+    }
+    if (bytes == 0) {
+        bytes = 1;
+    }
+    if (alignment <= natural_alignment) {
+        my_free_sized(ptr, bytes);
+    } else {
+        my_free_sized(static_cast<void**>(ptr)[-1], bytes + alignment);
+    }
+}
+
+// Used by the unsized operator delete, where only the alignment is known
+inline void deallocate(void* ptr, std::size_t alignment) noexcept {
+    if (ptr == nullptr) {
+        return;
+    }
+    if (alignment <= natural_alignment) {
+        my_free(ptr);
+    } else {
+        my_free(static_cast<void**>(ptr)[-1]);
+    }
+}
+
+} // namespace detail
+
+/*
+ * std::pmr adapter onto the secmalloc heap.
+ * All instances share the single heap, so they compare equal to each other.
+ */
+class memory_resource : public std::pmr::memory_resource {
+protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        void* ptr = detail::allocate(bytes, alignment);
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+    void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override {
+        detail::deallocate(ptr, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return dynamic_cast<const memory_resource*>(&other) != nullptr;
+    }
+};
+
+inline memory_resource* heap_resource() noexcept {
+    static memory_resource resource;
+    return &resource;
+}
+
+/*
+ * Scoped arena: bump allocation out of chunks taken from the secmalloc heap,
+ * everything is handed back at once when the arena goes out of scope.
+ */
+class arena : public std::pmr::monotonic_buffer_resource {
+public:
+    explicit arena(std::size_t initial_size = 1024)
+        : std::pmr::monotonic_buffer_resource(initial_size, heap_resource()) {}
+};
+
+/*
+ * Allocator for standard containers, every deallocation goes through my_free_sized.
+ */
+template <class T>
+class allocator {
+public:
+    using value_type = T;
+
+    allocator() noexcept = default;
+
+    template <class U>
+    allocator(const allocator<U>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        void* ptr = detail::allocate(n * sizeof(T), alignof(T));
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T* ptr, std::size_t n) noexcept {
+        detail::deallocate(ptr, n * sizeof(T), alignof(T));
+    }
+};
+
+template <class T, class U>
+bool operator==(const allocator<T>&, const allocator<U>&) noexcept {
+    return true;
+}
+
+template <class T, class U>
+bool operator!=(const allocator<T>&, const allocator<U>&) noexcept {
+    return false;
+}
+
+} // namespace secmalloc
+
+#endif // MY_SECMALLOC_HPP
@@ -8,24 +8,81 @@
 #include <stdarg.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#include <stdint.h>
 
-#define MEMORY_SIZE 10000
+#include "my_secmalloc_config.h"
+
+#define MEMORY_SIZE 10000 // Default heap size, SECMALLOC_OPTIONS="size=..." overrides it
 #define CANARY_VALUE 0xDEADBEEF
 
 typedef struct block {
     size_t size;
     size_t canary;
-    struct block* next;
+    union {
+        size_t next;      // Free block: offset + 1 of the next free block in the heap, 0 ends the list
+        size_t requested; // Allocated block: bytes asked for, the rest of size is slack
+    };
 } block_t;
 
+typedef struct my_heap_block {
+    size_t offset;    // Offset of the block header in the heap
+    size_t size;      // Usable bytes
+    int free;
+    int canary_ok;
+    void* ptr;        // Pointer handed to the user, NULL for a free block
+    size_t requested; // Bytes asked for, 0 for a free block
+} my_heap_block_t;
+
+// Return non zero to stop the walk
+typedef int (*my_heap_walk_cb)(const my_heap_block_t* block, void* arg);
+
+typedef struct my_stats {
+    size_t malloc_count;
+    size_t free_count;
+    size_t failed_count;
+    size_t bytes_in_use;
+    size_t peak_bytes;
+} my_stats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 extern block_t* free_list; // Déclaration de free_list
+block_t* my_free_list_next(block_t* block);
 
 extern char memory[MEMORY_SIZE];
 
 void* my_malloc(size_t size);
 void my_free(void* ptr);
+void my_free_sized(void* ptr, size_t size);
 void* my_calloc(size_t nmemb, size_t size);
 void* my_realloc(void* ptr, size_t size);
 
+// Heap size in use, after SECMALLOC_OPTIONS
+size_t my_heap_size(void);
+
+// Counters are only maintained when built with SECMALLOC_STATS
+void my_get_stats(my_stats_t* out);
+
+// Number of blocks visited, -1 if the heap layout is inconsistent
+// The callback runs with the heap locked and must not allocate
+int my_heap_walk(my_heap_walk_cb callback, void* arg);
+// JSON report of blocks, size classes and fragmentation, -1 if the heap layout is inconsistent or fd cannot be written
+int my_heap_dump(int fd);
+
+// File backed heap, to call before the first allocation
+// 0 = new heap, 1 = re-attached after a clean detach, 2 = recovered after a crash, -1 = error or heap in use
+int my_heap_attach(const char* path);
+int my_heap_detach(void);
+uint64_t my_heap_generation(void);
+// Root objects survive a restart, they are kept as offsets in the file header
+int my_heap_set_root(size_t index, void* ptr);
+void* my_heap_get_root(size_t index);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif // MY_SECMALLOC_PRIVATE_H
 
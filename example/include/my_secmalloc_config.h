@@ -0,0 +1,68 @@
+#ifndef MY_SECMALLOC_CONFIG_H
+#define MY_SECMALLOC_CONFIG_H
+
+/*
+ * Compile time policies of the allocator.
+ * Every policy is a constant, the core tests it with a plain if so the
+ * disabled branches are removed by the compiler but still type checked.
+ *
+ * SECMALLOC_HARDENING : 0 = no checks, 1 = canaries, 2 = canaries + double free and pointer checks
+ * SECMALLOC_FILL      : 0 = none, 1 = zero on malloc, 2 = zero on malloc + poison on free
+ * SECMALLOC_STATS     : 0 = none, 1 = operation counters readable with my_get_stats()
+ * SECMALLOC_TRACE     : 0 = none, 1 = log every operation with its clock() timing
+ *
+ * Startup, independent from the presets:
+ * SECMALLOC_EAGER_INIT : 1 = map the heap from a constructor, the entry points skip the init check
+ * SECMALLOC_PREFAULT   : 1 = fault the whole heap in when it is mapped (MADV_POPULATE_WRITE)
+ * SECMALLOC_HUGEPAGE   : 1 = map regions of at least HUGEPAGE_THRESHOLD bytes 2 MiB aligned, with MADV_HUGEPAGE
+ */
+
+#if defined(SECMALLOC_PRESET_FAST)
+#define SECMALLOC_HARDENING 0
+#define SECMALLOC_FILL 0
+#define SECMALLOC_STATS 0
+#define SECMALLOC_TRACE 0
+#elif defined(SECMALLOC_PRESET_PARANOID)
+#define SECMALLOC_HARDENING 2
+#define SECMALLOC_FILL 2
+#define SECMALLOC_STATS 1
+#define SECMALLOC_TRACE 1
+#endif
+
+// Default preset: the historical behaviour
+#ifndef SECMALLOC_HARDENING
+#define SECMALLOC_HARDENING 1
+#endif
+
+#ifndef SECMALLOC_FILL
+#define SECMALLOC_FILL 1
+#endif
+
+#ifndef SECMALLOC_STATS
+#define SECMALLOC_STATS 0
+#endif
+
+#ifndef SECMALLOC_TRACE
+#define SECMALLOC_TRACE 1
+#endif
+
+#ifndef SECMALLOC_EAGER_INIT
+#define SECMALLOC_EAGER_INIT 0
+#endif
+
+#ifndef SECMALLOC_PREFAULT
+#define SECMALLOC_PREFAULT 0
+#endif
+
+#ifndef SECMALLOC_HUGEPAGE
+#define SECMALLOC_HUGEPAGE 0
+#endif
+
+#define HUGEPAGE_THRESHOLD (2 * 1024 * 1024) // Huge page size, smaller regions cannot hold one
+
+// Alignment of every pointer returned by my_malloc, enough for any fundamental type and for the default operator new
+#define SECMALLOC_ALIGNMENT 16
+
+#define POISON_BYTE 0xDF // Written over freed memory when SECMALLOC_FILL >= 2
+
+#endif // MY_SECMALLOC_CONFIG_H
@@ -3,23 +3,113 @@
 #include <string.h>
 #include <time.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
 #include <unistd.h>
+#include <pthread.h>
 
-#define MEMORY_SIZE 10000 //Taille mémoire gérer par  
-#define CANARY_VALUE 0xDEADBEEF //Valeur du Canary
+#include "my_secmalloc.h"
 
-typedef struct block {
-    size_t size;
-    size_t canary;
-    struct block* next;
-} block_t;
+_Static_assert((sizeof(block_t) + sizeof(size_t)) % SECMALLOC_ALIGNMENT == 0, "user pointers must keep the block alignment");
+_Static_assert(MEMORY_SIZE % SECMALLOC_ALIGNMENT == 0, "the heap must be made of aligned spans");
 
 block_t* free_list = NULL; // Définition de free_list
 static void* memory_meta = NULL;
 static void* memory_data = NULL;
+static int heap_formatted = 0; // The whole heap is one free block until the first my_malloc
 
 static FILE *log_file = NULL;
+static my_stats_t stats;
+
+/*
+ * Runtime options, read once from SECMALLOC_OPTIONS, e.g. "size=64m,split=128,log_sample=100"
+ *   size       : heap size in bytes, k/m/g suffixes accepted (default MEMORY_SIZE)
+ *   split      : a free block is only split when the remainder is larger than this many bytes
+ *   log        : 0 to stop writing the log file
+ *   log_path   : file receiving the log lines (default memory.log)
+ *   log_sample : log one operation out of N
+ */
+static size_t heap_size = MEMORY_SIZE;
+static size_t split_threshold = sizeof(block_t) + 2 * sizeof(size_t);
+static int log_enabled = 1;
+static size_t log_sample = 1;
+static size_t log_counter = 0;
+static char log_path[256] = "memory.log";
+static int options_loaded = 0;
+
+// Every entry point holds it, the fork handlers take it so a child never sees a half updated heap
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Persistent heap layout, the helpers below are shared with the allocator
+ */
+
+#define HEAP_MAGIC 0x434C4C414D434553ULL // "SECMALLC"
+#define HEAP_VERSION 3 // 3: allocated blocks keep their requested size
+#define HEAP_ROOTS 16
+#define HEAP_NULL_OFFSET 0 // Stored offsets are shifted by one so that 0 stays NULL
+
+typedef struct heap_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t padding;
+    uint64_t generation;          // Bumped by every attach
+    uint64_t detached_generation; // Generation that was cleanly detached, differs after a crash
+    uint64_t memory_size;
+    uint64_t canary;
+    uint64_t formatted;
+    uint64_t free_list;
+    uint64_t roots[HEAP_ROOTS];
+} heap_header_t;
+
+static heap_header_t* heap_header = NULL;
+static size_t heap_mapping_size = 0;
+static int heap_fd = -1; // Kept open for the flock that makes the attach exclusive
+
+static size_t page_round(size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return (size + page - 1) / page * page;
+}
+
+static uint64_t meta_to_offset(block_t* block) {
+    return block == NULL ? HEAP_NULL_OFFSET : (uint64_t)((char*)block - (char*)memory_meta) + 1;
+}
+
+/*
+ * Free list links are offsets in the meta region, so the heap stays valid
+ * wherever it is mapped and a file backed heap is consistent on disk at all times.
+ */
+static inline block_t* next_free_block(block_t* block) {
+    return block->next == HEAP_NULL_OFFSET ? NULL : (block_t*)((char*)memory_meta + block->next - 1);
+}
+
+static inline void link_free_block(block_t* block, block_t* next) {
+    block->next = meta_to_offset(next);
+}
+
+static inline void set_free_list(block_t* block) {
+    free_list = block;
+    if (heap_header != NULL) {
+        heap_header->free_list = meta_to_offset(block);
+    }
+}
+
+block_t* my_free_list_next(block_t* block) {
+    return block == NULL ? NULL : next_free_block(block);
+}
+
+// NULL for an offset that cannot be a block header: out of the heap or not in address order
+static block_t* offset_to_meta(uint64_t offset, block_t* after) {
+    if (offset == HEAP_NULL_OFFSET || offset - 1 > heap_size - sizeof(block_t) || (offset - 1) % SECMALLOC_ALIGNMENT != 0) {
+        return NULL;
+    }
+    block_t* block = (block_t*)((char*)memory_meta + offset - 1);
+    return block > after ? block : NULL;
+}
 
 int check_canary(block_t* block);
 void log_message(const char *format, ...);
@@ -27,9 +117,11 @@ void log_operation(const char *operation, size_t size, clock_t start, clock_t en
 
 void open_log_file() {
     if (log_file == NULL) {
-        log_file = fopen("memory.log", "a");
+        log_file = fopen(log_path, "a");
         if (log_file == NULL) {
-            log_message("Error opening log file");
+            // Reporting through log_message would try to open it again
+            fprintf(stderr, "secmalloc: cannot open log file %s, logging disabled\n", log_path);
+            log_enabled = 0;
         }
     }
 }
@@ -56,6 +148,184 @@ void log_operation(const char *operation, size_t size, clock_t start, clock_t en
     log_message("%s: size=%zu, start=%ld, end=%ld", operation, size, start, end);
 }
 
+// clock() is only paid for when operations are traced and the log is on
+static inline clock_t trace_clock(void) {
+    return SECMALLOC_TRACE && log_enabled ? clock() : 0;
+}
+
+static inline int trace_sampled(void) {
+    return SECMALLOC_TRACE && log_enabled && log_counter++ % log_sample == 0;
+}
+
+static inline void trace_operation(const char *operation, size_t size, clock_t start) {
+    if (trace_sampled()) {
+        log_operation(operation, size, start, clock());
+    }
+}
+
+void my_get_stats(my_stats_t* out) {
+    if (out != NULL) {
+        pthread_mutex_lock(&heap_lock);
+        *out = stats;
+        pthread_mutex_unlock(&heap_lock);
+    }
+}
+
+/*
+ * fork() with a file backed heap: the MAP_SHARED mapping would be shared by both
+ * processes, each behind its own lock. The child keeps it read-only, so the parent's
+ * objects and roots stay readable, and allocates from a fresh anonymous heap.
+ * Nothing is copied, fork() costs the same whatever the size of the heap.
+ */
+static heap_header_t* parent_heap = NULL; // Parent's file mapping, read-only in a forked child
+static void* parent_data = NULL;
+
+static void prepare_fork(void) {
+    pthread_mutex_lock(&heap_lock);
+    if (log_file != NULL) {
+        fflush(log_file); // Otherwise the buffered lines are written by both processes
+    }
+}
+
+static void parent_after_fork(void) {
+    pthread_mutex_unlock(&heap_lock);
+}
+
+static void child_after_fork(void) {
+    if (heap_header != NULL) {
+        mprotect(heap_header, heap_mapping_size, PROT_READ);
+        close(heap_fd);
+        heap_fd = -1;
+        parent_heap = heap_header;
+        parent_data = memory_data;
+        heap_header = NULL;
+        heap_mapping_size = 0;
+
+        // Plain mappings, prefaulting a heap the child may never use would be paid on every fork
+        void* meta = mmap(NULL, heap_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        void* data = mmap(NULL, heap_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        free_list = NULL;
+        if (meta != MAP_FAILED && data != MAP_FAILED) {
+            memory_meta = meta;
+            memory_data = data;
+            heap_formatted = 0;
+        } else {
+            // No heap of its own: left full over the read-only regions, my_malloc returns NULL
+            if (meta != MAP_FAILED) {
+                munmap(meta, heap_size);
+            }
+            if (data != MAP_FAILED) {
+                munmap(data, heap_size);
+            }
+            heap_formatted = 1;
+        }
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+// Registered before main, a fork racing the first allocation still goes through the handlers
+__attribute__((constructor(101))) static void register_fork_handlers(void) {
+    pthread_atfork(prepare_fork, parent_after_fork, child_after_fork);
+}
+
+// Size with an optional k/m/g suffix, 0 if malformed or too large for a size_t
+static size_t parse_size(const char* value) {
+    char* end;
+    int shift = 0;
+    if (value[0] < '0' || value[0] > '9') {
+        return 0; // strtoull would accept signs and spaces
+    }
+    errno = 0;
+    unsigned long long size = strtoull(value, &end, 10);
+    if (errno == ERANGE) {
+        return 0;
+    }
+    switch (*end) {
+        case 'k': case 'K': shift = 10; end++; break;
+        case 'm': case 'M': shift = 20; end++; break;
+        case 'g': case 'G': shift = 30; end++; break;
+        default: break;
+    }
+    if (*end != '\0' || size > (SIZE_MAX >> shift)) {
+        return 0;
+    }
+    return (size_t)size << shift;
+}
+
+// Both regions must fit in physical memory, a larger heap could not be mapped and used
+static size_t max_heap_size(void) {
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || page <= 0) {
+        return SIZE_MAX;
+    }
+    return (size_t)pages / 2 * (size_t)page;
+}
+
+static int apply_option(const char* key, const char* value) {
+    size_t number = parse_size(value);
+    if (strcmp(key, "size") == 0) {
+        // Rounded first, the heap must still hold one block once rounded down
+        number &= ~(size_t)(SECMALLOC_ALIGNMENT - 1);
+        if (number <= sizeof(block_t) + 2 * sizeof(size_t) || number > max_heap_size()) {
+            return 0;
+        }
+        heap_size = number;
+    } else if (strcmp(key, "split") == 0 && (number > 0 || strcmp(value, "0") == 0)) {
+        split_threshold = number;
+    } else if (strcmp(key, "log") == 0 && (strcmp(value, "0") == 0 || strcmp(value, "1") == 0)) {
+        log_enabled = value[0] == '1';
+    } else if (strcmp(key, "log_path") == 0 && value[0] != '\0' && strlen(value) < sizeof(log_path)) {
+        strcpy(log_path, value);
+    } else if (strcmp(key, "log_sample") == 0 && number > 0) {
+        log_sample = number;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+void load_options() {
+    if (options_loaded) {
+        return;
+    }
+    options_loaded = 1;
+
+    const char* options = getenv("SECMALLOC_OPTIONS");
+    if (options == NULL) {
+        return;
+    }
+
+    char buffer[512];
+    if (strlen(options) >= sizeof(buffer)) {
+        fprintf(stderr, "secmalloc: SECMALLOC_OPTIONS too long, ignored\n");
+        return;
+    }
+    strcpy(buffer, options);
+
+    char* saveptr;
+    for (char* option = strtok_r(buffer, ",", &saveptr); option != NULL; option = strtok_r(NULL, ",", &saveptr)) {
+        char* value = strchr(option, '=');
+        int applied = 0;
+        if (value != NULL) {
+            *value = '\0';
+            applied = apply_option(option, value + 1);
+            *value = '='; // Report the option as it was written
+        }
+        if (!applied) {
+            fprintf(stderr, "secmalloc: ignoring option '%s'\n", option);
+        }
+    }
+}
+
+size_t my_heap_size(void) {
+    pthread_mutex_lock(&heap_lock);
+    load_options();
+    size_t size = heap_size;
+    pthread_mutex_unlock(&heap_lock);
+    return size;
+}
+
 size_t generate_canary() {
     return CANARY_VALUE;
 }
@@ -77,83 +347,164 @@ int check_canary(block_t* block) {
     return 1; // Canaries valid
 }
 
+// Huge pages need 2 MiB aligned ranges: reserve one extra huge page and trim around the aligned part
+static void* map_aligned(size_t size, size_t alignment) {
+    size = page_round(size); // The heap size is only rounded to SECMALLOC_ALIGNMENT, munmap needs a page boundary
+    char* reservation = mmap(NULL, size + alignment, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (reservation == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+    char* region = (char*)(((uintptr_t)reservation + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    if (region > reservation) {
+        munmap(reservation, region - reservation);
+    }
+    munmap(region + size, reservation + alignment - region);
+    return region;
+}
+
+static void prefault_region(char* region, size_t size) {
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(region, size, MADV_POPULATE_WRITE) == 0) {
+        return;
+    }
+#endif
+    // Kernels before 5.14: touch one byte per page
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    for (size_t offset = 0; offset < size; offset += page) {
+        ((volatile char*)region)[offset] = 0;
+    }
+}
+
+static void* map_region(const char* name) {
+    int huge = SECMALLOC_HUGEPAGE && heap_size >= HUGEPAGE_THRESHOLD;
+    void* region = huge ? map_aligned(heap_size, HUGEPAGE_THRESHOLD)
+                        : mmap(NULL, heap_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (region == MAP_FAILED) {
+        perror(name);
+        exit(EXIT_FAILURE);
+    }
+#ifdef MADV_HUGEPAGE
+    if (huge) {
+        madvise(region, heap_size, MADV_HUGEPAGE); // Before any page is touched, or it gets 4 KiB pages
+    }
+#endif
+    if (SECMALLOC_PREFAULT) {
+        prefault_region(region, heap_size); // Fault every page in now rather than on first touch
+    }
+    return region;
+}
+
 void initialize_memory() {
+    load_options();
     if (memory_meta == NULL) {
-        memory_meta = mmap(NULL, MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-        if (memory_meta == MAP_FAILED) {
-            perror("mmap meta");
-            exit(EXIT_FAILURE);
-        }
+        memory_meta = map_region("mmap meta");
     }
     if (memory_data == NULL) {
-        memory_data = mmap(NULL, MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-        if (memory_data == MAP_FAILED) {
-            perror("mmap data");
-            exit(EXIT_FAILURE);
-        }
+        memory_data = map_region("mmap data");
     }
 }
 
-void* my_malloc(size_t size) {
-    clock_t start = clock();
+// With SECMALLOC_EAGER_INIT the heap is mapped before main and the entry points skip the check
+static inline void ensure_memory(void) {
+    if (!SECMALLOC_EAGER_INIT) {
+        initialize_memory();
+    }
+}
+
+#if SECMALLOC_EAGER_INIT
+__attribute__((constructor(102))) static void eager_initialize_memory(void) {
     initialize_memory();
+}
+#endif
+
+static void* malloc_unlocked(size_t size) {
+    clock_t start = trace_clock();
+    ensure_memory();
 
-    if (size == 0 || size > MEMORY_SIZE - sizeof(block_t) - 2 * sizeof(size_t)) {
-        log_operation("malloc", size, start, start); // Start and end are the same when returning early
+    if (size == 0 || size > heap_size - sizeof(block_t) - 2 * sizeof(size_t)) {
+        if (trace_sampled()) {
+            log_operation("malloc", size, start, start); // Start and end are the same when returning early
+        }
+        if (SECMALLOC_STATS) {
+            stats.failed_count++;
+        }
         return NULL;
     }
 
-    size_t total_size = size + sizeof(block_t) + 2 * sizeof(size_t);
-    if (total_size > MEMORY_SIZE) {
+    size_t requested = size;
+    // Spans are rounded so every block, and the pointer handed out, stays SECMALLOC_ALIGNMENT aligned
+    size_t total_size = (size + sizeof(block_t) + 2 * sizeof(size_t) + SECMALLOC_ALIGNMENT - 1) & ~(size_t)(SECMALLOC_ALIGNMENT - 1);
+    size = total_size - sizeof(block_t) - 2 * sizeof(size_t);
+    if (total_size > heap_size) {
         return NULL;
     }
 
-    if (free_list == NULL) {
-        free_list = (block_t*)memory_meta;
-        free_list->size = MEMORY_SIZE - sizeof(block_t) - 2 * sizeof(size_t);
-        free_list->next = NULL;
+    // free_list is also NULL once every byte is allocated, it must not be formatted again then
+    if (!heap_formatted) {
+        block_t* first = (block_t*)memory_meta;
+        first->size = heap_size - sizeof(block_t) - 2 * sizeof(size_t);
+        link_free_block(first, NULL);
+        set_free_list(first);
+        heap_formatted = 1;
+        if (heap_header != NULL) {
+            heap_header->formatted = 1; // Last, a heap caught before this point is still empty
+        }
     }
 
     block_t* current = free_list;
     block_t* prev = NULL;
     while (current != NULL && current->size < size) {
         prev = current;
-        current = current->next;
+        current = next_free_block(current);
     }
 
     if (current == NULL) {
+        if (SECMALLOC_STATS) {
+            stats.failed_count++;
+        }
         return NULL;
     }
 
-    if (current->size > total_size + sizeof(block_t) + 2 * sizeof(size_t)) {
+    if (current->size > total_size + split_threshold) {
         block_t* new_block = (block_t*)((char*)current + total_size);
         new_block->size = current->size - total_size;
         new_block->next = current->next;
         current->size = size;
-        current->next = new_block;
+        link_free_block(current, new_block);
     }
 
     if (prev == NULL) {
-        free_list = current->next;
+        set_free_list(next_free_block(current));
     } else {
         prev->next = current->next;
     }
+    current->requested = requested; // Unlinked, the free list link is no longer needed
 
-    current->canary = CANARY_VALUE;
-    insert_canary(current);
+    if (SECMALLOC_HARDENING >= 1) {
+        insert_canary(current);
+    }
 
     void* user_ptr = (void*)((char*)memory_data + ((char*)current - (char*)memory_meta) + sizeof(block_t) + sizeof(size_t));
-    memset(user_ptr, 0, size);
+    if (SECMALLOC_FILL >= 1) {
+        memset(user_ptr, 0, size);
+    }
+
+    if (SECMALLOC_STATS) {
+        stats.malloc_count++;
+        stats.bytes_in_use += current->size;
+        if (stats.bytes_in_use > stats.peak_bytes) {
+            stats.peak_bytes = stats.bytes_in_use;
+        }
+    }
 
-    clock_t end = clock();
-    log_operation("malloc", size, start, end);
+    trace_operation("malloc", requested, start);
 
     return user_ptr;
 }
 
-void my_free(void* ptr) {
-    clock_t start_unused = clock();
-    initialize_memory();
+static void free_unlocked(void* ptr) {
+    clock_t start = trace_clock();
+    ensure_memory();
 
     if (ptr == NULL) {
         return;
@@ -161,12 +512,17 @@ void my_free(void* ptr) {
 
     block_t* block = (block_t*)((char*)memory_meta + ((char*)ptr - (char*)memory_data - sizeof(size_t) - sizeof(block_t)));
 
-    if ((char*)block < (char*)memory_meta || (char*)block >= (char*)memory_meta + MEMORY_SIZE) {
+    if ((char*)block < (char*)memory_meta || (char*)block >= (char*)memory_meta + heap_size) {
         fprintf(stderr, "Error: Attempt to free memory outside allocated memory\n");
         return;
     }
 
-    if (!check_canary(block)) {
+    if (SECMALLOC_HARDENING >= 2 && ((char*)block - (char*)memory_meta) % SECMALLOC_ALIGNMENT != 0) {
+        fprintf(stderr, "Error: Attempt to free a pointer that was not returned by my_malloc\n");
+        return;
+    }
+
+    if (SECMALLOC_HARDENING >= 1 && !check_canary(block)) {
         fprintf(stderr, "Error: Memory corruption detected (canary mismatch)\n");
         return;
     }
@@ -175,18 +531,34 @@ void my_free(void* ptr) {
     block_t* prev = NULL;
     while (current != NULL && current < block) {
         prev = current;
-        current = current->next;
+        current = next_free_block(current);
+    }
+
+    // A block already on the free list, or swallowed by a coalesced neighbour, is being freed twice
+    if (SECMALLOC_HARDENING >= 2 && (current == block
+        || (prev != NULL && (char*)block < (char*)prev + prev->size + sizeof(block_t) + 2 * sizeof(size_t)))) {
+        fprintf(stderr, "Error: Double free detected\n");
+        return;
+    }
+
+    if (SECMALLOC_STATS) {
+        stats.free_count++;
+        stats.bytes_in_use -= block->size;
+    }
+
+    if (SECMALLOC_FILL >= 2) {
+        memset(ptr, POISON_BYTE, block->size);
     }
 
     if (prev != NULL && (char*)prev + prev->size + sizeof(block_t) + 2 * sizeof(size_t) == (char*)block) {
         prev->size += block->size + sizeof(block_t) + 2 * sizeof(size_t);
         block = prev;
     } else {
-        block->next = current;
+        link_free_block(block, current);
         if (prev != NULL) {
-            prev->next = block;
+            link_free_block(prev, block);
         } else {
-            free_list = block;
+            set_free_list(block);
         }
     }
 
@@ -195,13 +567,35 @@ void my_free(void* ptr) {
         block->next = current->next;
     }
 
-    clock_t end_unused = clock();
-    log_operation("free", 0, start_unused, end_unused);
+    trace_operation("free", 0, start);
 }
 
-void* my_calloc(size_t nmemb, size_t size) {
-    clock_t start = clock();
-    initialize_memory();
+static void free_sized_unlocked(void* ptr, size_t size) {
+    ensure_memory();
+
+    if (ptr == NULL) {
+        return;
+    }
+
+    block_t* block = (block_t*)((char*)memory_meta + ((char*)ptr - (char*)memory_data - sizeof(size_t) - sizeof(block_t)));
+
+    if ((char*)block < (char*)memory_meta || (char*)block >= (char*)memory_meta + heap_size) {
+        fprintf(stderr, "Error: Attempt to free memory outside allocated memory\n");
+        return;
+    }
+
+    // A block is never smaller than what was asked for, so a larger size means the caller freed the wrong pointer
+    if (size > block->size) {
+        fprintf(stderr, "Error: Sized free does not match the allocated block (%zu > %zu)\n", size, block->size);
+        return;
+    }
+
+    free_unlocked(ptr);
+}
+
+static void* calloc_unlocked(size_t nmemb, size_t size) {
+    clock_t start = trace_clock();
+    ensure_memory();
 
     if (nmemb == 0 || size == 0) {
         return NULL;
@@ -212,55 +606,435 @@ void* my_calloc(size_t nmemb, size_t size) {
         return NULL;
     }
 
-    void* ptr = my_malloc(total_size);
+    void* ptr = malloc_unlocked(total_size);
     if (ptr == NULL) {
         return NULL;
     }
 
-    memset(ptr, 0, total_size);
+    if (SECMALLOC_FILL == 0) {
+        memset(ptr, 0, total_size); // Otherwise my_malloc already zeroed it
+    }
 
-    clock_t end = clock();
-    log_operation("calloc", total_size, start, end);
+    trace_operation("calloc", total_size, start);
 
     return ptr;
 }
 
-void* my_realloc(void* ptr, size_t size) {
-    clock_t start = clock();
-    initialize_memory();
+static void* realloc_unlocked(void* ptr, size_t size) {
+    clock_t start = trace_clock();
+    ensure_memory();
 
     if (size == 0) {
-        my_free(ptr);
+        free_unlocked(ptr);
         return NULL;
     }
 
     if (ptr == NULL) {
-        return my_malloc(size);
+        return malloc_unlocked(size);
     }
 
     block_t* block = (block_t*)((char*)memory_meta + ((char*)ptr - (char*)memory_data - sizeof(size_t) - sizeof(block_t)));
+    if (SECMALLOC_HARDENING >= 2 && !check_canary(block)) {
+        fprintf(stderr, "Error: Memory corruption detected (canary mismatch)\n");
+        return NULL;
+    }
     size_t old_size = block->size;
 
     if (old_size >= size) {
-        clock_t end = clock();
-        log_operation("realloc (no move)", size, start, end);
+        block->requested = size;
+        trace_operation("realloc (no move)", size, start);
         return ptr;
     }
 
-    void* new_ptr = my_malloc(size);
+    void* new_ptr = malloc_unlocked(size);
     if (new_ptr == NULL) {
         return NULL;
     }
 
     memcpy(new_ptr, ptr, old_size);
-    my_free(ptr);
+    free_unlocked(ptr);
+
+    trace_operation("realloc (move)", size, start);
+
+    return new_ptr;
+}
+
+void* my_malloc(size_t size) {
+    pthread_mutex_lock(&heap_lock);
+    void* ptr = malloc_unlocked(size);
+    pthread_mutex_unlock(&heap_lock);
+    return ptr;
+}
+
+void my_free(void* ptr) {
+    pthread_mutex_lock(&heap_lock);
+    free_unlocked(ptr);
+    pthread_mutex_unlock(&heap_lock);
+}
+
+void my_free_sized(void* ptr, size_t size) {
+    pthread_mutex_lock(&heap_lock);
+    free_sized_unlocked(ptr, size);
+    pthread_mutex_unlock(&heap_lock);
+}
 
-    clock_t end = clock();
-    log_operation("realloc (move)", size, start, end);
+void* my_calloc(size_t nmemb, size_t size) {
+    pthread_mutex_lock(&heap_lock);
+    void* ptr = calloc_unlocked(nmemb, size);
+    pthread_mutex_unlock(&heap_lock);
+    return ptr;
+}
 
+void* my_realloc(void* ptr, size_t size) {
+    pthread_mutex_lock(&heap_lock);
+    void* new_ptr = realloc_unlocked(ptr, size);
+    pthread_mutex_unlock(&heap_lock);
     return new_ptr;
 }
 
+/*
+ * Heap introspection
+ */
+
+#define SIZE_CLASSES 12 // Power of two classes, from <= 16 bytes to > 16 KiB
+
+static size_t size_class(size_t size) {
+    size_t class = 0;
+    while (class < SIZE_CLASSES - 1 && size > ((size_t)16 << class)) {
+        class++;
+    }
+    return class;
+}
+
+static int heap_walk_unlocked(my_heap_walk_cb callback, void* arg) {
+    if (callback == NULL || memory_meta == NULL || !heap_formatted) {
+        return 0;
+    }
+
+    // Blocks tile the meta region and the free list is sorted by address, so both are walked together
+    size_t block_span = sizeof(block_t) + 2 * sizeof(size_t);
+    block_t* next_free = free_list;
+    size_t offset = 0;
+    int count = 0;
+    while (offset < heap_size) {
+        block_t* block = (block_t*)((char*)memory_meta + offset);
+        // Header corrupted: no room left for a block, the block runs past the end of the heap
+        // or the next header would not be aligned. The order keeps every subtraction from wrapping.
+        if (heap_size - offset < block_span || block->size > heap_size - offset - block_span
+            || (block->size + block_span) % SECMALLOC_ALIGNMENT != 0) {
+            return -1;
+        }
+
+        my_heap_block_t info;
+        info.offset = offset;
+        info.size = block->size;
+        info.free = block == next_free;
+        info.canary_ok = info.free || SECMALLOC_HARDENING == 0 || check_canary(block);
+        info.ptr = info.free ? NULL : (char*)memory_data + offset + sizeof(block_t) + sizeof(size_t);
+        info.requested = info.free ? 0 : block->requested <= block->size ? block->requested : block->size;
+        if (info.free) {
+            next_free = next_free_block(block);
+        }
+
+        count++;
+        if (callback(&info, arg) != 0) {
+            return count;
+        }
+        offset += block->size + block_span;
+    }
+
+    return next_free == NULL ? count : -1; // A free list entry outside the block chain is corruption
+}
+
+int my_heap_walk(my_heap_walk_cb callback, void* arg) {
+    pthread_mutex_lock(&heap_lock);
+    int count = heap_walk_unlocked(callback, arg);
+    pthread_mutex_unlock(&heap_lock);
+    return count;
+}
+
+static int count_block(const my_heap_block_t* block, void* arg) {
+    (void)block;
+    (void)arg;
+    return 0;
+}
+
+typedef struct heap_report {
+    int fd;
+    int failed;
+    size_t blocks;
+    size_t allocated_count;
+    size_t allocated_bytes;
+    size_t allocated_slack;
+    size_t allocated_overhead;
+    size_t free_count;
+    size_t free_bytes;
+    size_t largest_free;
+    size_t corrupted;
+    size_t allocated_classes[SIZE_CLASSES];
+    size_t free_classes[SIZE_CLASSES];
+} heap_report_t;
+
+static void report_printf(heap_report_t* report, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (vdprintf(report->fd, format, args) < 0) {
+        report->failed = 1;
+    }
+    va_end(args);
+}
+
+static int report_block(const my_heap_block_t* block, void* arg) {
+    heap_report_t* report = arg;
+    size_t class = size_class(block->size);
+
+    report_printf(report, "%s\n    {\"offset\": %zu, \"size\": %zu, \"requested\": %zu, \"free\": %s, \"canary_ok\": %s}",
+            report->blocks ? "," : "", block->offset, block->size, block->requested,
+            block->free ? "true" : "false", block->canary_ok ? "true" : "false");
+    report->blocks++;
+
+    if (block->free) {
+        report->free_count++;
+        report->free_bytes += block->size;
+        report->free_classes[class]++;
+        if (block->size > report->largest_free) {
+            report->largest_free = block->size;
+        }
+    } else {
+        report->allocated_count++;
+        report->allocated_bytes += block->size;
+        report->allocated_slack += block->size - block->requested;
+        report->allocated_overhead += sizeof(block_t) + 2 * sizeof(size_t);
+        report->allocated_classes[class]++;
+        if (!block->canary_ok) {
+            report->corrupted++;
+        }
+    }
+    return report->failed; // No point walking on once the fd is broken
+}
+
+int my_heap_dump(int fd) {
+    heap_report_t report;
+    memset(&report, 0, sizeof(report));
+    report.fd = fd;
+
+    // The whole report is one snapshot, attach or detach cannot swap the heap under it
+    pthread_mutex_lock(&heap_lock);
+    report_printf(&report, "{\n  \"segments\": [{\"meta\": \"%p\", \"data\": \"%p\", \"size\": %zu}],\n",
+            memory_meta, memory_data, heap_size);
+    report_printf(&report, "  \"blocks\": [");
+    int status = heap_walk_unlocked(report_block, &report);
+    report_printf(&report, "\n  ],\n");
+
+    report_printf(&report, "  \"allocated\": {\"count\": %zu, \"bytes\": %zu, \"slack\": %zu, \"corrupted\": %zu},\n",
+            report.allocated_count, report.allocated_bytes, report.allocated_slack, report.corrupted);
+    report_printf(&report, "  \"free\": {\"count\": %zu, \"bytes\": %zu, \"largest\": %zu},\n",
+            report.free_count, report.free_bytes, report.largest_free);
+
+    report_printf(&report, "  \"size_classes\": [");
+    for (size_t class = 0; class < SIZE_CLASSES; class++) {
+        report_printf(&report, "%s\n    {\"max\": ", class ? "," : "");
+        if (class < SIZE_CLASSES - 1) {
+            report_printf(&report, "%zu", (size_t)16 << class);
+        } else {
+            report_printf(&report, "null");
+        }
+        report_printf(&report, ", \"allocated\": %zu, \"free\": %zu}", report.allocated_classes[class], report.free_classes[class]);
+    }
+    report_printf(&report, "\n  ],\n");
+
+    // External: share of free memory unusable by a request of the largest free size
+    // Internal: share of the allocated bytes nobody asked for, alignment rounding and unsplit tails
+    // Metadata: share of the allocated spans taken by headers and canaries
+    double external = report.free_bytes ? 1.0 - (double)report.largest_free / report.free_bytes : 0.0;
+    double internal = report.allocated_bytes ? (double)report.allocated_slack / report.allocated_bytes : 0.0;
+    size_t allocated_span = report.allocated_bytes + report.allocated_overhead;
+    double metadata = allocated_span ? (double)report.allocated_overhead / allocated_span : 0.0;
+    report_printf(&report, "  \"fragmentation\": {\"external\": %.4f, \"internal\": %.4f, \"metadata\": %.4f},\n",
+            external, internal, metadata);
+    report_printf(&report, "  \"consistent\": %s\n}\n", status < 0 ? "false" : "true");
+    pthread_mutex_unlock(&heap_lock);
+
+    return status < 0 || report.failed ? -1 : 0;
+}
+
+/*
+ * Persistent heap
+ * The file holds a header page followed by the meta and the data regions.
+ * Every link is an offset, so the file is usable as is after a crash: re-attach
+ * only reads it to check the header and the block chain before trusting it.
+ */
+static void unmap_heap_file(void) {
+    munmap(heap_header, heap_mapping_size);
+    close(heap_fd);
+    heap_fd = -1;
+    heap_header = NULL;
+    heap_mapping_size = 0;
+    memory_meta = NULL;
+    memory_data = NULL;
+    free_list = NULL;
+    heap_formatted = 0;
+    if (SECMALLOC_EAGER_INIT) {
+        initialize_memory(); // Entry points rely on a mapped heap
+    }
+}
+
+// Checks only read the mapping, 0 if it does not describe a valid heap
+static int restore_heap(void) {
+    if (heap_header->magic != HEAP_MAGIC || heap_header->version != HEAP_VERSION
+        || heap_header->memory_size != heap_size || heap_header->canary != CANARY_VALUE) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < HEAP_ROOTS; i++) {
+        if (heap_header->roots[i] != HEAP_NULL_OFFSET && heap_header->roots[i] - 1 >= heap_size) {
+            return 0;
+        }
+    }
+
+    // Nothing was allocated before the heap was formatted, whatever the free list says
+    heap_formatted = heap_header->formatted != 0;
+    free_list = NULL;
+    if (heap_formatted && heap_header->free_list != HEAP_NULL_OFFSET) {
+        free_list = offset_to_meta(heap_header->free_list, NULL);
+        if (free_list == NULL) {
+            return 0;
+        }
+    }
+
+    // The walk follows the free list by address, so an out of range, unordered or cyclic link fails it
+    if (heap_walk_unlocked(count_block, NULL) < 0) {
+        free_list = NULL;
+        heap_formatted = 0;
+        return 0;
+    }
+    return 1;
+}
+
+static int heap_attach_unlocked(const char* path) {
+    load_options();
+    if (path == NULL || heap_header != NULL || heap_formatted) {
+        return -1; // Must be chosen before the first allocation
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return -1;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+        close(fd); // Another live process owns this heap
+        return -1;
+    }
+
+    struct stat st;
+    size_t header_size = page_round(sizeof(heap_header_t));
+    size_t region_size = page_round(heap_size);
+    size_t mapping_size = header_size + 2 * region_size;
+    if (fstat(fd, &st) < 0 || (st.st_size != 0 && (size_t)st.st_size != mapping_size)
+        || (st.st_size == 0 && ftruncate(fd, mapping_size) < 0)) {
+        close(fd);
+        return -1;
+    }
+
+    void* mapping = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    // Anonymous heap mapped but never used, e.g. by SECMALLOC_EAGER_INIT
+    // Only dropped once the file is mapped, so every error above leaves it usable
+    if (memory_meta != NULL) {
+        munmap(memory_meta, heap_size);
+        munmap(memory_data, heap_size);
+    }
+
+    heap_fd = fd;
+    heap_header = mapping;
+    heap_mapping_size = mapping_size;
+    memory_meta = (char*)mapping + header_size;
+    memory_data = (char*)memory_meta + region_size;
+
+    int attached = 0;
+    if (st.st_size == 0) {
+        heap_header->magic = HEAP_MAGIC;
+        heap_header->version = HEAP_VERSION;
+        heap_header->memory_size = heap_size;
+        heap_header->canary = CANARY_VALUE;
+    } else if (!restore_heap()) {
+        unmap_heap_file();
+        return -1;
+    } else {
+        attached = heap_header->detached_generation == heap_header->generation ? 1 : 2;
+    }
+
+    heap_header->generation++;
+    msync(heap_header, header_size, MS_SYNC);
+    return attached;
+}
+
+static int heap_detach_unlocked(void) {
+    if (heap_header == NULL) {
+        return -1;
+    }
+
+    // The regions reach the disk before the header says they were detached cleanly
+    int status = msync(heap_header, heap_mapping_size, MS_SYNC);
+    heap_header->detached_generation = heap_header->generation;
+    if (msync(heap_header, page_round(sizeof(heap_header_t)), MS_SYNC) < 0) {
+        status = -1;
+    }
+
+    unmap_heap_file();
+    return status < 0 ? -1 : 0;
+}
+
+int my_heap_attach(const char* path) {
+    pthread_mutex_lock(&heap_lock);
+    int status = heap_attach_unlocked(path);
+    pthread_mutex_unlock(&heap_lock);
+    return status;
+}
+
+int my_heap_detach(void) {
+    pthread_mutex_lock(&heap_lock);
+    int status = heap_detach_unlocked();
+    pthread_mutex_unlock(&heap_lock);
+    return status;
+}
+
+uint64_t my_heap_generation(void) {
+    pthread_mutex_lock(&heap_lock);
+    uint64_t generation = heap_header == NULL ? 0 : heap_header->generation;
+    pthread_mutex_unlock(&heap_lock);
+    return generation;
+}
+
+int my_heap_set_root(size_t index, void* ptr) {
+    int status = -1;
+    pthread_mutex_lock(&heap_lock);
+    if (heap_header != NULL && index < HEAP_ROOTS
+        && (ptr == NULL || ((char*)ptr >= (char*)memory_data && (char*)ptr < (char*)memory_data + heap_size))) {
+        heap_header->roots[index] = ptr == NULL ? HEAP_NULL_OFFSET : (uint64_t)((char*)ptr - (char*)memory_data) + 1;
+        status = 0;
+    }
+    pthread_mutex_unlock(&heap_lock);
+    return status;
+}
+
+void* my_heap_get_root(size_t index) {
+    void* ptr = NULL;
+    pthread_mutex_lock(&heap_lock);
+    // A forked child reads the roots of its parent's heap
+    heap_header_t* header = heap_header != NULL ? heap_header : parent_heap;
+    char* data = heap_header != NULL ? memory_data : parent_data;
+    if (header != NULL && index < HEAP_ROOTS && header->roots[index] != HEAP_NULL_OFFSET) {
+        ptr = data + header->roots[index] - 1;
+    }
+    pthread_mutex_unlock(&heap_lock);
+    return ptr;
+}
+
 #ifdef DYNAMIC
 void* malloc(size_t size) {
     return my_malloc(size);
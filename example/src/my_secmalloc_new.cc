@@ -0,0 +1,110 @@
+/*
+ * Opt-in replacement of the global operator new/delete.
+ * Link this object (or lib my_secmalloc_new.a) to put every C++ allocation on the secmalloc heap.
+ */
+
+#include <new>
+
+#include "my_secmalloc.hpp"
+
+static void* secmalloc_new(std::size_t size, std::size_t alignment) {
+    for (;;) {
+        void* ptr = secmalloc::detail::allocate(size, alignment);
+        if (ptr != nullptr) {
+            return ptr;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+static void* secmalloc_new_nothrow(std::size_t size, std::size_t alignment) noexcept {
+    try {
+        return secmalloc_new(size, alignment);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void* operator new(std::size_t size) {
+    return secmalloc_new(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void* operator new[](std::size_t size) {
+    return secmalloc_new(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    return secmalloc_new(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+    return secmalloc_new(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return secmalloc_new_nothrow(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return secmalloc_new_nothrow(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return secmalloc_new_nothrow(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return secmalloc_new_nothrow(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* ptr) noexcept {
+    secmalloc::detail::deallocate(ptr, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void operator delete[](void* ptr) noexcept {
+    secmalloc::detail::deallocate(ptr, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void operator delete(void* ptr, std::size_t size) noexcept {
+    secmalloc::detail::deallocate(ptr, size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void operator delete[](void* ptr, std::size_t size) noexcept {
+    secmalloc::detail::deallocate(ptr, size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void operator delete(void* ptr, std::align_val_t alignment) noexcept {
+    secmalloc::detail::deallocate(ptr, static_cast<std::size_t>(alignment));
+}
+
+void operator delete[](void* ptr, std::align_val_t alignment) noexcept {
+    secmalloc::detail::deallocate(ptr, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* ptr, std::size_t size, std::align_val_t alignment) noexcept {
+    secmalloc::detail::deallocate(ptr, size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete[](void* ptr, std::size_t size, std::align_val_t alignment) noexcept {
+    secmalloc::detail::deallocate(ptr, size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    secmalloc::detail::deallocate(ptr, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    secmalloc::detail::deallocate(ptr, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void operator delete(void* ptr, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    secmalloc::detail::deallocate(ptr, static_cast<std::size_t>(alignment));
+}
+
+void operator delete[](void* ptr, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    secmalloc::detail::deallocate(ptr, static_cast<std::size_t>(alignment));
+}
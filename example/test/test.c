@@ -5,6 +5,10 @@
 #include <stdint.h>
 #include <stdio.h>   // For fopen, fseek, ftell, fread, fclose
 #include <string.h>  // For strstr
+#include <sys/wait.h> // For waitpid
+#include <sys/resource.h> // For setrlimit
+#include <signal.h>
+#include <pthread.h>
 #include "my_secmalloc.private.h" 
 
 #define SEEK_END 2
@@ -202,7 +206,7 @@ Test(memory_leak, no_leak) {
     size_t total_free_size = 0;
     while (current != NULL) {
         total_free_size += current->size + sizeof(block_t) + 2 * sizeof(size_t);
-        current = current->next;
+        current = my_free_list_next(current);
     }
     cr_assert_eq(total_free_size, MEMORY_SIZE, "Memory leak detected, total free size does not match");
 }
@@ -362,6 +366,528 @@ Test(canary, canary_check_after_multiple_operations) {
     block_t* block = free_list;
     while (block != NULL) {
         cr_assert(check_canary(block), "Canary check failed after multiple operations");
-        block = block->next;
+        block = my_free_list_next(block);
     }
 }
+
+// Sized free
+Test(my_free, sized_free) {
+    void* ptr = my_malloc(100);
+    cr_assert_not_null(ptr, "my_malloc failed to allocate memory");
+    cr_assert_eq((uintptr_t)ptr % SECMALLOC_ALIGNMENT, 0, "my_malloc returned a pointer not aligned for operator new");
+    my_free_sized(ptr, 100);
+}
+
+Test(my_free, sized_free_mismatch) {
+    void* ptr = my_malloc(16);
+    cr_assert_not_null(ptr, "my_malloc failed to allocate memory");
+
+    FILE *stderr_backup = stderr;
+    stderr = fopen("/dev/null", "w");
+    my_free_sized(ptr, 4096); // Rejected, the block is smaller
+    fclose(stderr);
+    stderr = stderr_backup;
+
+    my_free_sized(ptr, 16);
+}
+
+// Heap walk
+static int count_free_blocks(const my_heap_block_t* block, void* arg) {
+    if (block->free) {
+        (*(int*)arg)++;
+    }
+    return 0;
+}
+
+Test(heap_walk, free_and_allocated_blocks) {
+    void* ptr1 = my_malloc(100);
+    void* ptr2 = my_malloc(200);
+    void* ptr3 = my_malloc(300);
+    my_free(ptr2);
+
+    int free_blocks = 0;
+    int blocks = my_heap_walk(count_free_blocks, &free_blocks);
+    cr_assert_eq(blocks, 4, "Expected three allocations and the tail of the heap");
+    cr_assert_eq(free_blocks, 2, "Expected the freed block and the tail of the heap to be free");
+
+    my_free(ptr1);
+    my_free(ptr3);
+}
+
+Test(heap_walk, dump_is_consistent) {
+    void* ptr = my_malloc(100);
+    FILE* out = fopen("/dev/null", "w");
+    cr_assert_eq(my_heap_dump(fileno(out)), 0, "Heap dump reported an inconsistent heap");
+    fclose(out);
+    my_free(ptr);
+}
+
+static int find_requested(const my_heap_block_t* block, void* arg) {
+    my_heap_block_t* found = arg;
+    if (block->ptr == found->ptr) {
+        *found = *block;
+        return 1;
+    }
+    return 0;
+}
+
+// Rounding a 100 byte request to the block alignment leaves 4 bytes of slack
+Test(heap_walk, slack_is_internal_fragmentation) {
+    void* ptr = my_malloc(100);
+    my_heap_block_t found = { .ptr = ptr };
+    my_heap_walk(find_requested, &found);
+    cr_assert_eq(found.requested, 100, "Requested size not recorded");
+    cr_assert_eq(found.size, 104, "Unexpected block size");
+
+    FILE* out = tmpfile();
+    cr_assert_eq(my_heap_dump(fileno(out)), 0, "Heap dump reported an inconsistent heap");
+    char report[4096] = { 0 };
+    rewind(out);
+    fread(report, 1, sizeof(report) - 1, out);
+    fclose(out);
+    cr_assert(strstr(report, "\"slack\": 4,") != NULL, "Slack missing from the report");
+    cr_assert(strstr(report, "\"internal\": 0.0385") != NULL, "Internal fragmentation is not slack / allocated bytes");
+    my_free(ptr);
+}
+
+// A full heap must not be formatted again by the next allocation
+Test(limits, full_heap_stays_allocated) {
+    void* ptr = my_malloc(MEMORY_SIZE - sizeof(block_t) - 2 * sizeof(size_t));
+    cr_assert_not_null(ptr, "my_malloc failed to allocate the whole heap");
+    cr_assert_null(my_malloc(1), "Allocation succeeded on a full heap");
+    my_free(ptr);
+}
+
+/*
+ * Test cases for the persistent heap
+ */
+Test(persistent_heap, warm_restart) {
+    char path[] = "/tmp/secmalloc_heapXXXXXX";
+    int fd = mkstemp(path);
+    cr_assert_geq(fd, 0, "Failed to create the heap file");
+    close(fd);
+    unlink(path);
+
+    cr_assert_eq(my_heap_attach(path), 0, "Expected a new heap");
+    uint64_t generation = my_heap_generation();
+    char* keep = my_malloc(64);
+    void* dropped = my_malloc(128);
+    cr_assert_not_null(keep, "my_malloc failed on the file backed heap");
+    strcpy(keep, "survives restart");
+    my_free(dropped);
+    cr_assert_eq(my_heap_set_root(0, keep), 0, "Failed to set the root object");
+    cr_assert_eq(my_heap_detach(), 0, "Failed to detach the heap");
+
+    cr_assert_eq(my_heap_attach(path), 1, "Expected the heap to be re-attached");
+    cr_assert_eq(my_heap_generation(), generation + 1, "Generation not bumped on re-attach");
+    char* root = my_heap_get_root(0);
+    cr_assert_not_null(root, "Root object lost across restart");
+    cr_assert(strcmp(root, "survives restart") == 0, "Root object content lost across restart");
+
+    int blocks = my_heap_walk(count_free_blocks, &(int){0});
+    cr_assert_geq(blocks, 2, "Re-attached heap is not walkable");
+    my_free(root);
+    my_heap_detach();
+    unlink(path);
+}
+
+static void new_heap_path(char* path) {
+    int fd = mkstemp(path);
+    cr_assert_geq(fd, 0, "Failed to create the heap file");
+    close(fd);
+    unlink(path);
+}
+
+static char* read_heap_file(const char* path, long* length) {
+    FILE* file = fopen(path, "rb");
+    fseek(file, 0, SEEK_END);
+    *length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* content = malloc(*length);
+    fread(content, 1, *length, file);
+    fclose(file);
+    return content;
+}
+
+Test(persistent_heap, crashed_heap_is_recovered) {
+    char path[] = "/tmp/secmalloc_heapXXXXXX";
+    new_heap_path(path);
+
+    // The child dies while attached, without detaching
+    pid_t pid = fork();
+    if (pid == 0) {
+        my_heap_attach(path);
+        char* keep = my_malloc(64);
+        strcpy(keep, "survives crash");
+        my_heap_set_root(0, keep);
+        my_malloc(200);
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+
+    cr_assert_eq(my_heap_attach(path), 2, "A crashed heap must be recovered and reported as such");
+    char* root = my_heap_get_root(0);
+    cr_assert_not_null(root, "Root object lost across crash");
+    cr_assert(strcmp(root, "survives crash") == 0, "Root object content lost across crash");
+    cr_assert_not_null(my_malloc(64), "Recovered heap cannot allocate");
+    cr_assert_eq(my_heap_detach(), 0, "Failed to detach the heap");
+    cr_assert_eq(my_heap_attach(path), 1, "Heap detached cleanly after recovery");
+    my_heap_detach();
+    unlink(path);
+}
+
+Test(persistent_heap, corrupted_heap_is_rejected_untouched) {
+    char path[] = "/tmp/secmalloc_heapXXXXXX";
+    new_heap_path(path);
+
+    cr_assert_eq(my_heap_attach(path), 0, "Expected a new heap");
+    my_free(my_malloc(100));
+    my_malloc(50);
+    cr_assert_eq(my_heap_detach(), 0, "Failed to detach the heap");
+
+    // Break the size of the first block, right after the header page
+    FILE* file = fopen(path, "r+b");
+    size_t broken = SIZE_MAX / 2;
+    fseek(file, sysconf(_SC_PAGESIZE), SEEK_SET);
+    fwrite(&broken, sizeof(broken), 1, file);
+    fclose(file);
+
+    long before_length, after_length;
+    char* before = read_heap_file(path, &before_length);
+    cr_assert_eq(my_heap_attach(path), -1, "A corrupted heap must not be attached");
+    char* after = read_heap_file(path, &after_length);
+    cr_assert(before_length == after_length && memcmp(before, after, before_length) == 0, "A rejected heap must be left as it was");
+    free(before);
+    free(after);
+    unlink(path);
+}
+
+static void write_block_size(const char* path, size_t offset, size_t size) {
+    FILE* file = fopen(path, "r+b");
+    fseek(file, sysconf(_SC_PAGESIZE) + offset, SEEK_SET); // Meta region starts after the header page
+    fwrite(&size, sizeof(size), 1, file);
+    fclose(file);
+}
+
+// A heap made of one free block whose size leaves no room for the next header, or wraps the walk around
+Test(persistent_heap, out_of_bounds_block_is_rejected) {
+    char path[] = "/tmp/secmalloc_heapXXXXXX";
+    new_heap_path(path);
+    cr_assert_eq(my_heap_attach(path), 0, "Expected a new heap");
+    my_free(my_malloc(50));
+    cr_assert_eq(my_heap_detach(), 0, "Failed to detach the heap");
+
+    size_t span = sizeof(block_t) + 2 * sizeof(size_t);
+    alarm(5); // A walk that wraps around never returns
+
+    // Next header at 9992: unaligned and past the end of the heap
+    write_block_size(path, 0, MEMORY_SIZE - span - 8);
+    cr_assert_eq(my_heap_attach(path), -1, "A block ending past the heap must be rejected");
+
+    // Next header at 9984, its size brings the walk back to offset 0
+    write_block_size(path, 0, MEMORY_SIZE - span - 16);
+    write_block_size(path, MEMORY_SIZE - 16, (size_t)0 - (MEMORY_SIZE - 16) - span);
+    cr_assert_eq(my_heap_attach(path), -1, "A block chain wrapping around must be rejected");
+
+    alarm(0);
+    unlink(path);
+}
+
+// With SECMALLOC_EAGER_INIT the anonymous heap is already mapped, a failed attach must keep it
+Test(persistent_heap, failed_attach_keeps_the_heap) {
+    cr_assert_eq(my_heap_attach("/nonexistent/dir/heap"), -1, "Attach to a missing directory must fail");
+    void* ptr = my_malloc(100);
+    cr_assert_not_null(ptr, "my_malloc failed after a failed attach");
+    my_free(ptr);
+}
+
+Test(persistent_heap, live_heap_is_exclusive) {
+    char path[] = "/tmp/secmalloc_heapXXXXXX";
+    new_heap_path(path);
+    int ready[2];
+    int done[2];
+    cr_assert_eq(pipe(ready), 0, "pipe failed");
+    cr_assert_eq(pipe(done), 0, "pipe failed");
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        char byte = my_heap_attach(path) == 0;
+        write(ready[1], &byte, 1);
+        read(done[0], &byte, 1);
+        _exit(0);
+    }
+    char byte = 0;
+    read(ready[0], &byte, 1);
+    cr_assert_eq(byte, 1, "Child failed to attach the heap");
+    cr_assert_eq(my_heap_attach(path), -1, "A heap attached by a live process must be refused");
+    write(done[1], &byte, 1);
+    waitpid(pid, NULL, 0);
+    unlink(path);
+}
+
+/*
+ * Test cases for SECMALLOC_OPTIONS
+ */
+Test(options, heap_size_from_environment) {
+    setenv("SECMALLOC_OPTIONS", "size=64k,log_sample=2", 1);
+    cr_assert_eq(my_heap_size(), (size_t)64 * 1024, "Heap size option not applied");
+    void* ptr = my_malloc(2 * MEMORY_SIZE);
+    cr_assert_not_null(ptr, "my_malloc failed on the larger heap");
+    my_free(ptr);
+}
+
+Test(options, malformed_option_is_ignored) {
+    setenv("SECMALLOC_OPTIONS", "size=lots,unknown=1", 1);
+
+    FILE *stderr_backup = stderr;
+    stderr = fopen("/dev/null", "w");
+    size_t size = my_heap_size();
+    fclose(stderr);
+    stderr = stderr_backup;
+
+    cr_assert_eq(size, MEMORY_SIZE, "Malformed size must keep the default");
+}
+
+Test(options, oversized_heap_is_ignored) {
+    setenv("SECMALLOC_OPTIONS", "size=17179869185g", 1);
+
+    FILE *stderr_backup = stderr;
+    stderr = fopen("/dev/null", "w");
+    size_t size = my_heap_size();
+    fclose(stderr);
+    stderr = stderr_backup;
+
+    cr_assert_eq(size, MEMORY_SIZE, "An overflowing size must keep the default");
+}
+
+// 47 rounds down to 32, less than a header and its canaries
+Test(options, heap_smaller_than_a_block_is_ignored) {
+    setenv("SECMALLOC_OPTIONS", "size=47", 1);
+
+    FILE *stderr_backup = stderr;
+    stderr = fopen("/dev/null", "w");
+    size_t size = my_heap_size();
+    fclose(stderr);
+    stderr = stderr_backup;
+
+    cr_assert_eq(size, MEMORY_SIZE, "A heap too small for one block must keep the default");
+    cr_assert_null(my_malloc(SIZE_MAX - 7), "Oversized allocation succeeded");
+}
+
+Test(options, unwritable_log_path) {
+    setenv("SECMALLOC_OPTIONS", "log_path=/nonexistent/memory.log", 1);
+
+    FILE *stderr_backup = stderr;
+    stderr = fopen("/dev/null", "w");
+    void* ptr = my_malloc(100);
+    my_free(ptr);
+    fclose(stderr);
+    stderr = stderr_backup;
+
+    cr_assert_not_null(ptr, "my_malloc failed without a log file");
+}
+
+/*
+ * Test cases for fork safety
+ */
+static void* churn(void* arg) {
+    (void)arg;
+    for (int i = 0; i < 20000; ++i) {
+        my_free(my_malloc(16 + i % 200));
+    }
+    return NULL;
+}
+
+Test(fork, fork_while_allocating) {
+    setenv("SECMALLOC_OPTIONS", "log=0", 1);
+    my_free(my_malloc(1));
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, churn, NULL);
+    for (int i = 0; i < 20; ++i) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            void* ptr = my_malloc(100);
+            my_free(ptr);
+            _exit(ptr != NULL && my_heap_walk(count_free_blocks, &(int){0}) > 0 ? 0 : 1);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        cr_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0, "Child saw a corrupted heap");
+    }
+    pthread_join(thread, NULL);
+}
+
+// The child reads the parent's objects and allocates from a heap of its own, the file is untouched
+Test(fork, file_heap_is_read_only_in_the_child) {
+    char path[] = "/tmp/secmalloc_heapXXXXXX";
+    new_heap_path(path);
+    cr_assert_eq(my_heap_attach(path), 0, "Expected a new heap");
+    char* keep = my_malloc(64);
+    strcpy(keep, "parent");
+    my_heap_set_root(0, keep);
+    int blocks = my_heap_walk(count_free_blocks, &(int){0});
+
+    long before_length, after_length;
+    char* before = read_heap_file(path, &before_length);
+    pid_t pid = fork();
+    if (pid == 0) {
+        char* root = my_heap_get_root(0);
+        char* ptr1 = my_malloc(200);
+        char* ptr2 = my_malloc(300);
+        int ok = root == keep && strcmp(root, "parent") == 0 && ptr1 != NULL && ptr2 != NULL
+                 && my_heap_walk(count_free_blocks, &(int){0}) == 3 // Its two blocks and the tail
+                 && my_heap_detach() == -1;                       // Nothing attached in the child
+        _exit(ok ? 0 : 1);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    cr_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0, "Child failed to read the parent's heap or use its own");
+
+    char* after = read_heap_file(path, &after_length);
+    cr_assert(before_length == after_length && memcmp(before, after, before_length) == 0, "The child wrote to the parent's heap file");
+    cr_assert_eq(my_heap_walk(count_free_blocks, &(int){0}), blocks, "The child's allocations reached the parent's heap");
+    cr_assert_not_null(my_malloc(200), "my_malloc failed in the parent after fork");
+    free(before);
+    free(after);
+    my_heap_detach();
+    unlink(path);
+}
+
+Test(fork, parent_objects_cannot_be_written) {
+    char path[] = "/tmp/secmalloc_heapXXXXXX";
+    new_heap_path(path);
+    cr_assert_eq(my_heap_attach(path), 0, "Expected a new heap");
+    char* keep = my_malloc(64);
+    strcpy(keep, "parent");
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        keep[0] = 'c';
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    cr_assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV, "The child could write to the parent's heap");
+    cr_assert(strcmp(keep, "parent") == 0, "The child changed a parent object");
+    my_heap_detach();
+    unlink(path);
+}
+
+// Without memory for a heap of its own, my_malloc in the child fails instead of faulting
+Test(fork, child_without_memory_gets_null) {
+    char path[] = "/tmp/secmalloc_heapXXXXXX";
+    new_heap_path(path);
+
+    pid_t helper = fork();
+    if (helper == 0) {
+        my_heap_attach(path);
+        char* keep = my_malloc(64);
+        strcpy(keep, "parent");
+        my_heap_set_root(0, keep);
+
+        // Caps the address space at what is mapped now, the child cannot map anything
+        long pages = 0;
+        FILE* statm = fopen("/proc/self/statm", "r");
+        fscanf(statm, "%ld", &pages);
+        fclose(statm);
+        struct rlimit limit = { pages * sysconf(_SC_PAGESIZE), pages * sysconf(_SC_PAGESIZE) };
+        setrlimit(RLIMIT_AS, &limit);
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            char* root = my_heap_get_root(0);
+            _exit(my_malloc(100) == NULL && root != NULL && strcmp(root, "parent") == 0 ? 0 : 1);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        _exit(WIFEXITED(status) ? WEXITSTATUS(status) : 2);
+    }
+    int status;
+    waitpid(helper, &status, 0);
+    cr_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0, "my_malloc did not fail cleanly in the child");
+    unlink(path);
+}
+
+Test(heap_walk, dump_to_bad_fd_fails) {
+    void* ptr = my_malloc(100);
+    cr_assert_eq(my_heap_dump(-1), -1, "Heap dump must report write errors");
+    my_free(ptr);
+}
+
+/*
+ * Test cases for the checks only built in by the paranoid preset (make test_paranoid)
+ */
+#if SECMALLOC_HARDENING >= 2
+// Runs an operation with stderr sent to a temporary file, returns what it printed
+static char* capture_stderr(void (*operation)(void*), void* arg) {
+    FILE *stderr_backup = stderr;
+    stderr = tmpfile();
+    operation(arg);
+    fflush(stderr);
+    long length = ftell(stderr);
+    char* content = calloc(1, length + 1);
+    rewind(stderr);
+    fread(content, 1, length, stderr);
+    fclose(stderr);
+    stderr = stderr_backup;
+    return content;
+}
+
+static void free_operation(void* ptr) {
+    my_free(ptr);
+}
+
+Test(paranoid, double_free_is_rejected) {
+    void* ptr1 = my_malloc(100);
+    void* ptr2 = my_malloc(100);
+    my_free(ptr1);
+    int blocks = my_heap_walk(count_free_blocks, &(int){0});
+
+    char* output = capture_stderr(free_operation, ptr1);
+    cr_assert(strstr(output, "Double free detected") != NULL, "Double free not reported");
+    cr_assert_eq(my_heap_walk(count_free_blocks, &(int){0}), blocks, "Double free changed the heap");
+    free(output);
+    my_free(ptr2);
+}
+
+Test(paranoid, misaligned_free_is_rejected) {
+    char* ptr = my_malloc(100);
+    char* output = capture_stderr(free_operation, ptr + sizeof(size_t));
+    cr_assert(strstr(output, "not returned by my_malloc") != NULL, "Misaligned free not reported");
+    free(output);
+
+    int free_blocks = 0;
+    my_heap_walk(count_free_blocks, &free_blocks);
+    cr_assert_eq(free_blocks, 1, "Misaligned free released a block");
+    my_free(ptr);
+}
+
+Test(paranoid, freed_memory_is_poisoned) {
+    unsigned char* ptr = my_malloc(64);
+    memset(ptr, 'A', 64);
+    my_free(ptr);
+    for (size_t i = 0; i < 64; i++) {
+        cr_assert_eq(ptr[i], POISON_BYTE, "Freed byte %zu not poisoned", i);
+    }
+}
+
+#if SECMALLOC_STATS
+Test(paranoid, stats_count_operations) {
+    my_stats_t before, after;
+    my_get_stats(&before);
+    void* ptr1 = my_malloc(100);
+    void* ptr2 = my_malloc(200);
+    my_free(ptr1);
+    cr_assert_null(my_malloc(2 * MEMORY_SIZE), "Oversized allocation succeeded");
+    my_get_stats(&after);
+
+    cr_assert_eq(after.malloc_count - before.malloc_count, 2, "malloc_count");
+    cr_assert_eq(after.free_count - before.free_count, 1, "free_count");
+    cr_assert_eq(after.failed_count - before.failed_count, 1, "failed_count");
+    cr_assert_geq(after.bytes_in_use - before.bytes_in_use, 200, "bytes_in_use");
+    cr_assert_geq(after.peak_bytes, before.bytes_in_use + 300, "peak_bytes");
+    my_free(ptr2);
+}
+#endif
+#endif
@@ -0,0 +1,123 @@
+#include <criterion/criterion.h>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+#include "my_secmalloc.hpp"
+
+/*
+ * Test cases for secmalloc::memory_resource
+ */
+Test(memory_resource, allocate_and_deallocate) {
+    std::pmr::memory_resource* resource = secmalloc::heap_resource();
+    void* ptr = resource->allocate(100);
+    cr_assert_not_null(ptr, "memory_resource failed to allocate memory");
+    resource->deallocate(ptr, 100);
+}
+
+Test(memory_resource, over_aligned_allocation) {
+    std::pmr::memory_resource* resource = secmalloc::heap_resource();
+    void* ptr = resource->allocate(24, 64);
+    cr_assert_eq(reinterpret_cast<std::uintptr_t>(ptr) % 64, 0u, "Over-aligned allocation is not aligned");
+    resource->deallocate(ptr, 24, 64);
+}
+
+Test(memory_resource, resources_compare_equal) {
+    secmalloc::memory_resource other;
+    cr_assert(secmalloc::heap_resource()->is_equal(other), "All secmalloc resources share the same heap");
+}
+
+Test(memory_resource, pmr_vector) {
+    std::pmr::vector<int> values(secmalloc::heap_resource());
+    for (int i = 0; i < 100; ++i) values.push_back(i);
+    for (int i = 0; i < 100; ++i) {
+        cr_assert_eq(values[i], i, "Data not preserved in pmr::vector");
+    }
+}
+
+/*
+ * Test cases for secmalloc::arena
+ */
+Test(arena, scoped_allocations) {
+    secmalloc::arena scope(256);
+    std::pmr::vector<long> values(&scope);
+    for (long i = 0; i < 50; ++i) values.push_back(i);
+    cr_assert_eq(values.back(), 49, "Data not preserved in arena backed vector");
+}
+
+/*
+ * Test cases for secmalloc::allocator
+ */
+Test(allocator, std_vector) {
+    std::vector<double, secmalloc::allocator<double>> values;
+    for (int i = 0; i < 64; ++i) values.push_back(i * 0.5);
+    cr_assert_eq(values[10], 5.0, "Data not preserved in secmalloc::allocator vector");
+}
+
+Test(allocator, rebind_compares_equal) {
+    secmalloc::allocator<int> a;
+    secmalloc::allocator<char> b(a);
+    cr_assert(a == b, "Rebound allocators must compare equal");
+}
+
+/*
+ * Test cases for the global operator new/delete replacement
+ */
+namespace {
+
+struct heap_search {
+    const void* ptr;
+    bool found;
+};
+
+int find_block(const my_heap_block_t* block, void* arg) {
+    heap_search* search = static_cast<heap_search*>(arg);
+    const char* start = static_cast<const char*>(block->ptr);
+    if (!block->free && search->ptr >= start && search->ptr < start + block->size) {
+        search->found = true;
+        return 1;
+    }
+    return 0;
+}
+
+bool in_heap(const void* ptr) {
+    heap_search search = { ptr, false };
+    my_heap_walk(find_block, &search);
+    return search.found;
+}
+
+struct alignas(64) over_aligned {
+    char data[24];
+};
+
+} // namespace
+
+Test(operator_new, plain_new) {
+    long double* value = new long double(1.5L);
+    cr_assert(in_heap(value), "operator new did not allocate from the secmalloc heap");
+    cr_assert_eq(reinterpret_cast<std::uintptr_t>(value) % alignof(long double), 0u, "operator new returned a misaligned pointer");
+    delete value;
+}
+
+Test(operator_new, array_new) {
+    int* values = new int[32];
+    cr_assert(in_heap(values), "operator new[] did not allocate from the secmalloc heap");
+    for (int i = 0; i < 32; ++i) values[i] = i;
+    cr_assert_eq(values[31], 31, "Data not preserved in new[] array");
+    delete[] values;
+}
+
+Test(operator_new, over_aligned_new) {
+    over_aligned* value = new over_aligned;
+    cr_assert(in_heap(value), "Aligned operator new did not allocate from the secmalloc heap");
+    cr_assert_eq(reinterpret_cast<std::uintptr_t>(value) % 64, 0u, "Aligned operator new returned a misaligned pointer");
+    delete value;
+}
+
+Test(operator_new, nothrow_new) {
+    char* small = new (std::nothrow) char[16];
+    cr_assert(in_heap(small), "Nothrow operator new did not allocate from the secmalloc heap");
+    delete[] small;
+
+    char* huge = new (std::nothrow) char[MEMORY_SIZE * 1024];
+    cr_assert_null(huge, "Nothrow operator new must return NULL when the heap is exhausted");
+}